@@ -2,8 +2,11 @@
 
 #include <vector>
 #include <cstdint>
+#include <memory>
+#include <type_traits>
 
 #include "Vector3.h"
+#include "thread_pool.h"
 
 namespace MTVT
 {
@@ -32,6 +35,18 @@ struct DebugStats
     size_t cubes_z = 0;
     size_t degenerate_triangles = 0;
     size_t invalid_triangles = 0;
+    // per-worker time spent sampling, and time spent waiting during the sampling pass
+    std::vector<double> sampling_busy_time;
+    std::vector<double> sampling_idle_time;
+    size_t sampling_tiles = 0;
+    size_t sampling_tiles_stolen = 0;
+    // calls made to the sampler, and lattice points which were filled without calling it
+    size_t sampler_calls = 0;
+    size_t sampler_calls_skipped = 0;
+    // cubes the geometry pass skipped using the occupancy summary, without reading them
+    size_t cubes_skipped = 0;
+    // vertices dropped after the geometry pass because no triangle referenced them
+    size_t unreferenced_vertices = 0;
 };
 
 typedef uint32_t VertexRef;
@@ -39,6 +54,13 @@ typedef uint16_t EdgeFlags;
 typedef size_t Index;
 typedef uint8_t EdgeAddr;
 
+// samples the field at count positions, writing one value per position
+typedef void (*BatchSampler)(const Vector3* positions, float* values, size_t count);
+// samples the field at count positions like a BatchSampler, and also writes the gradient
+// of the field at each position if gradients isn't null. the sampling pass only asks for
+// values, so it's worth skipping the derivatives when they aren't wanted
+typedef void (*GradientSampler)(const Vector3* positions, float* values, Vector3* gradients, size_t count);
+
 struct Mesh
 {
     std::vector<Vector3> vertices;
@@ -62,29 +84,112 @@ public:
         POST_PROCESED
     };
 
+    // FULL_GRID keeps the whole lattice in memory and runs each pass over all of it.
+    // STREAMING keeps only a small ring of z-layers in memory, and sweeps through the
+    // volume sampling, generating vertices, generating geometry and accumulating normals
+    // as it goes, so each layer is only brought into cache once.
+    // SURFACE_FOLLOWING only samples and meshes around the surface, flooding out from seed
+    // cubes (see setSurfaceSeeds). surfaces which aren't connected to a seed are missed. the flood
+    // itself runs on one thread, sampling each wave of it together, and the other passes split the
+    // surface into z-slabs like FULL_GRID. the buffers are still allocated for the whole grid, but
+    // are laid out in bricks, and only the bricks around the surface are ever written, so only their
+    // pages take up memory. the address space (and on Windows, the commit charge) is still O(volume)
+    enum StorageMode
+    {
+        FULL_GRID,
+        STREAMING,
+        SURFACE_FOLLOWING
+    };
+
+    // FACE_ACCUMULATED sums the normals of the triangles around each vertex once the geometry
+    // is finished. SAMPLE_GRADIENT estimates the gradient of the field at each vertex instead, from
+    // central differences of the samples around the ends of the edges it was made from. this is
+    // done per sample in parallel, and only needs the vertex pass to have finished. STREAMING
+    // storage doesn't keep enough layers around for the differences, so always accumulates faces.
+    // with a lipschitz constant set, samples in skipped blocks only hold a bound on the field,
+    // so the gradients next to those blocks are rougher. SAMPLER_GRADIENT asks the sampler for the
+    // exact gradient at each vertex, which needs a GradientSampler, and costs one call per vertex
+    enum NormalMode
+    {
+        FACE_ACCUMULATED,
+        SAMPLE_GRADIENT,
+        SAMPLER_GRADIENT
+    };
+
 private:
+    // each sample stores the vertices for its 7 canonical (positive-direction) edges only,
+    // the other 7 edges around it are stored by the neighbours at their far ends
     struct EdgeReferences
     {
-        VertexRef references[14];
+        VertexRef references[7];
+    };
+
+    // the kinds of sample visited by forEachLayerSample: those on the outer shell of the lattice,
+    // which need all of the bounds logic, those inside it, and those inside it but on the side of a brick
+    enum LayerSampleKind
+    {
+        SHELL_SAMPLE,
+        INTERIOR_SAMPLE,
+        BRICK_SIDE_SAMPLE
+    };
+    template <int kind>
+    using LayerSample = std::integral_constant<int, kind>;
+
+    struct GeometryCounters
+    {
+        size_t degenerate_triangles = 0;
+        size_t invalid_triangles = 0;
+        size_t tetrahedra_evaluated = 0;
+        size_t indices_written = 0;
+        size_t cubes_skipped = 0;
+    };
+
+    // the range of cubes in a row whose centers have any crossing edges (empty if x_start >= x_end)
+    struct CubeRowSpan
+    {
+        int x_start;
+        int x_end;
     };
 
 private:
     float (*sampler)(Vector3);
+    BatchSampler batch_sampler;
+    GradientSampler gradient_sampler = nullptr;
+    // a copy of the callable given to the templated configure, a copy of that for each worker (see
+    // prepareWorkerCallables), and the copying function and batch loop instantiated for its type
+    std::shared_ptr<void> callable;
+    std::vector<std::shared_ptr<void>> worker_callables;
+    std::shared_ptr<void> (*callable_copy)(const void* callable) = nullptr;
+    void (*callable_sampler)(void* callable, const Vector3* positions, float* values, size_t count) = nullptr;
     float threshold;
+    float lipschitz = 0.0f;
     Vector3 min_extent, max_extent;
     Vector3 size;
     int cubes_x, cubes_y, cubes_z;
     int samples_x, samples_y, samples_z;
     float resolution;
     unsigned short thread_count;
+    Executor* executor = nullptr;
+    std::unique_ptr<ThreadPool> owned_pool;
     size_t grid_data_length;
+    size_t buffer_length;
 
     LatticeType structure;
     ClusteringMode clustering;
+    // the vertex pass kernel for the lattice and clustering mode, picked once per build (see selectKernels)
+    void (Builder::*vertex_kernel)(const int, const int, const int, const int, const int, const int, std::vector<Vector3>&, std::vector<Index>&) = nullptr;
+    StorageMode storage = FULL_GRID;
+    int tile_size = 0;
+    NormalMode normal_mode = FACE_ACCUMULATED;
+    bool angle_weighted_normals = false;
+    bool compact_vertices = false;
+    std::vector<Vector3> surface_seeds;
 
-    int index_offsets_evenz[14];
-    int index_offsets_oddz[14];
-    Vector3 vector_offsets[14];
+    // position in the sample buffers of each x, y and z lattice coordinate. the index
+    // of a sample is the sum of its three entries (see populateIndexOffsets)
+    std::vector<Index> sample_index_x;
+    std::vector<Index> sample_index_y;
+    std::vector<Index> sample_index_z;
 
     float* sample_values = nullptr;
 #if defined DEBUG_GRID
@@ -92,33 +197,175 @@ private:
 #endif
     EdgeFlags* sample_crossing_flags = nullptr;
     EdgeReferences* sample_edge_indices = nullptr;
+    // occupancy summary of the cubes, filled in by the vertex pass: a span per row of cubes (cubes_y
+    // per cube layer), and a flag per block of rows saying whether any of them have crossings
+    std::vector<CubeRowSpan> cube_row_spans;
+    std::vector<uint8_t> cube_block_occupancy;
+    // which bricks of the sample buffers have been touched by the current surface following build
+    std::vector<uint8_t> surface_bricks;
     std::vector<Vector3> vertices;
+    std::vector<std::vector<Vector3>> slab_vertices;
+    std::vector<std::vector<Index>> slab_touched_edges;
     std::vector<Vector3> normals;
     std::vector<VertexRef> indices;
+    std::vector<VertexRef> vertex_remap;
+    // the contribution of each triangle corner (i.e. each index) to its vertex's normal, and
+    // the corners around each vertex in CSR form, used to gather the normals in parallel
+    std::vector<Vector3> corner_normals;
+    std::vector<Index> vertex_corner_offsets;
+    std::vector<Index> vertex_corners;
     size_t degenerate_triangles;
     size_t invalid_triangles;
     size_t tetrahedra_evaluated;
+    size_t cubes_skipped;
+    size_t unreferenced_vertices;
+    WorkStealingScheduler sampling_scheduler;
+    std::vector<double> sampling_busy_time;
+    std::vector<double> sampling_idle_time;
+    size_t sampling_tiles;
+    size_t sampling_tiles_stolen;
+    size_t sampler_calls;
+    size_t sampler_calls_skipped;
 
 public:
     Builder();
+    ~Builder();
 
     void configure(Vector3 minimum_extent, Vector3 maximum_extent, float cube_size, float (*sample_func)(Vector3), float threshold_value);
+    void configure(Vector3 minimum_extent, Vector3 maximum_extent, float cube_size, BatchSampler batch_sample_func, float threshold_value);
+    void configure(Vector3 minimum_extent, Vector3 maximum_extent, float cube_size, GradientSampler gradient_sample_func, float threshold_value);
+    // takes any other callable which either maps a Vector3 to a float or samples a batch like a
+    // BatchSampler, such as a capturing lambda or a functor. the builder keeps its own copy, and each
+    // worker samples through a separate copy of that, which is never called from two threads at once.
+    // so the call operator doesn't need to be const or thread safe, and can keep per-worker context
+    // like scratch buffers or caches (but not anything tied to a particular OS thread, since the
+    // executor may run a worker on different threads from one pass to the next). the worker copies
+    // are made on the first build, and last until the next configure. the sampling loop is
+    // instantiated for the callable's type, so a cheap field gets inlined into it rather than
+    // paying an indirect call per sample
+    template <typename Sampler>
+    void configure(Vector3 minimum_extent, Vector3 maximum_extent, float cube_size, const Sampler& sample_func, float threshold_value)
+    {
+        typedef std::decay_t<Sampler> Callable;
+        configureVolume(minimum_extent, maximum_extent, cube_size, threshold_value);
+        resetSampler();
+        callable = std::make_shared<Callable>(sample_func);
+        callable_copy = copyCallable<Callable>;
+        callable_sampler = callableBatch<Callable>;
+    }
     void configureModes(LatticeType lattice_type, ClusteringMode clustering_mode, unsigned short parallel_threads);
+    void setExecutor(Executor* parallel_executor);
+    // declares that the sampled field changes by at most lipschitz_constant per unit distance
+    // (1 for a true SDF), allowing sampling to skip blocks which the surface can't pass through.
+    // 0 disables this. configure resets it, since it describes a particular sampler
+    void setLipschitzConstant(float lipschitz_constant);
+    void setStorageMode(StorageMode storage_mode);
+    void setNormalMode(NormalMode mode);
+    // weights each triangle's contribution to the FACE_ACCUMULATED normal of a vertex by the angle
+    // of its corner there, rather than by its area. off by default
+    void setAngleWeightedNormals(bool enabled);
+    // walks the vertex and geometry passes in blocks of tile_cubes cubes along each axis rather
+    // than in whole planes, so the neighbouring layers stay in cache at large resolutions.
+    // 0 (the default) disables tiling. the output is the same for any thread count, but
+    // the order of the vertices and triangles depends on the tile size
+    void setTileSize(int tile_cubes);
+    // points on (or within a cube of) the surface, which SURFACE_FOLLOWING mode starts from. with
+    // no seeds, it scans a coarse grid of the volume for them instead, which can miss small
+    // features. configure clears the seeds, since they describe a particular sampler
+    void setSurfaceSeeds(const std::vector<Vector3>& seed_points);
+    // removes the vertices which no triangle references (the ends of edges whose triangles all
+    // came out degenerate or invalid) after the geometry pass, renumbering the indices to match.
+    // the remaining vertices keep their order. off by default
+    void setVertexCompaction(bool enabled);
+    // checks the geometry pass's case table against marching each tetrahedron separately, for
+    // every state of a cube, and throws if they disagree. debug builds do this when the table
+    // is built, and the benchmark runs it once up front, so release builds are covered too
+    static void verifyGeometryCaseTable();
     Mesh generate(DebugStats& stats);
+    // generates directly into an existing mesh, reusing the capacity of its buffers
+    // rather than copying the results out. useful when generating repeatedly
+    void generateInto(Mesh& mesh, DebugStats& stats);
 
 private:
+    void configureVolume(Vector3 minimum_extent, Vector3 maximum_extent, float cube_size, float threshold_value);
+    void resetSampler();
+    void prepareWorkerCallables();
+    template <typename Callable>
+    static std::shared_ptr<void> copyCallable(const void* callable)
+    {
+        return std::make_shared<Callable>(*static_cast<const Callable*>(callable));
+    }
+    template <typename Callable>
+    static void callableBatch(void* callable, const Vector3* positions, float* values, size_t count)
+    {
+        Callable& sample_func = *static_cast<Callable*>(callable);
+        if constexpr (std::is_invocable_v<Callable&, const Vector3*, float*, size_t>)
+            sample_func(positions, values, count);
+        else
+        {
+            for (size_t i = 0; i < count; ++i)
+                values[i] = sample_func(positions[i]);
+        }
+    }
+    void build(DebugStats& stats);
+    void selectKernels();
+    Executor& getExecutor();
     void prepareBuffers();
     void destroyBuffers();
     void populateIndexOffsets();
+    Index rowIndex(const int yi, const int zi) const;
+    Index sampleIndex(const int xi, const int yi, const int zi) const;
+    bool isContiguousRow(const int x_start, const int x_end) const;
+    void rowNeighbourIndices(const int yi, const int zi, Index* row_indices) const;
+    void rowNeighbourOffsets(const int yi, const int zi, Index* row_indices, ptrdiff_t* row_offsets) const;
+    void neighbourIndices(const int xi, const int zi, const Index* row_indices, Index* connected_indices) const;
+    void cubeNeighbourIndices(const int xi, const int zi, const Index index, const Index* row_indices, const ptrdiff_t* row_offsets, Index* connected_indices) const;
     void samplingPass();
-    void samplingLayer(const int start, const int layers);
+    void samplingBlock(const size_t worker, const int x_start, const int x_end, const int y_start, const int y_end, const int z_start, const int z_end);
+    void samplingBlockBounded(const size_t worker, const int x_start, const int x_end, const int y_start, const int y_end, const int z_start, const int z_end, size_t& calls, size_t& skipped);
+    void sampleBatch(const size_t worker, const Vector3* positions, float* values, size_t count);
     Vector3 clampToBounds(Vector3 v);
     VertexRef addVertex(const float* neighbour_values, const EdgeAddr p, const float thresh_diff, const float value, const Vector3& position, std::vector<Vector3>& verts);
-    VertexRef addMergedVertex(const float* neighbour_values, const float thresh_diff, const float value, const Vector3& position, EdgeFlags usable_edges, std::vector<Vector3>& verts, EdgeReferences& edges);
-    void addVerticesIndividually(const float* neighbour_values, const float thresh_diff, const float value, const Vector3& position, EdgeFlags usable_edges, std::vector<Vector3>& verts, EdgeReferences& edges);
+    VertexRef addMergedVertex(const float* neighbour_values, const float thresh_diff, const float value, const Vector3& position, EdgeFlags usable_edges, std::vector<Vector3>& verts, VertexRef* edge_refs);
+    void addVerticesIndividually(const float* neighbour_values, const float thresh_diff, const float value, const Vector3& position, EdgeFlags usable_edges, std::vector<Vector3>& verts, VertexRef* edge_refs);
+    void storeEdgeReferences(const Index index, const Index* connected_indices, EdgeFlags owned_edges, const VertexRef* edge_refs, std::vector<Index>& touched_edges);
+    bool isRejectedSample(const int xi, const int yi, const int zi) const;
+    bool connectedSampleIndices(const int xi, const int yi, const int zi, const Index* row_indices, Index* connected_indices) const;
     void vertexPass();
+    void interiorRange(const int zi, int& x_start, int& x_end, int& y_start, int& y_end) const;
+    template <int kind>
+    bool layerSampleNeighbours(const int xi, const int yi, const int zi, const Index index, const Index* row_indices, const ptrdiff_t* row_offsets, Index* connected_indices, LayerSample<kind>) const;
+    template <typename RowFunc, typename SampleFunc>
+    void forEachLayerSample(const int zi, const int x_start, const int x_end, const int y_start, const int y_end, RowFunc&& row_func, SampleFunc&& sample_func);
+    void flagBlock(const int x_start, const int x_end, const int y_start, const int y_end, const int z_start, const int z_end);
+    void vertexSlab(const int start, const int layers, std::vector<Vector3>& verts, std::vector<Index>& touched_edges);
+    template <bool merge_vertices>
+    void vertexBlock(const int x_start, const int x_end, const int y_start, const int y_end, const int z_start, const int z_end, std::vector<Vector3>& verts, std::vector<Index>& touched_edges);
+    void stitchVertexSlabs();
+    void markOccupiedCube(const int xi, const int yi, const int zi);
+    template <typename RowFunc>
+    size_t forEachOccupiedRow(const int zi, const int x_start, const int x_end, const int y_start, const int y_end, RowFunc&& row_func) const;
     void geometryPass();
+    size_t geometryCountSlab(const int start, const int layers);
+    size_t cubeTriangleBound(const int xi, const int yi, const int zi, const Index central_sample_index, const Index* row_indices, const ptrdiff_t* row_offsets) const;
+    void geometrySlab(const int start, const int layers, VertexRef* output, GeometryCounters& counters);
+    void geometryBlock(const int x_start, const int x_end, const int y_start, const int y_end, const int z_start, const int z_end, VertexRef* output, GeometryCounters& counters);
+    void streamingPass(float& sampling, float& vertex, float& geometry, float& normaling);
+    void samplingLayer(const int zi);
+    void surfacePass(float& sampling, float& vertex, float& geometry, float& normaling);
+    uint64_t latticeKey(const int xi, const int yi, const int zi) const;
+    void latticeCoords(const uint64_t key, int& xi, int& yi, int& zi) const;
+    void addLatticeNeighbours(const uint64_t key, std::vector<uint64_t>& keys) const;
+    void sampleLatticePoints(const std::vector<uint64_t>& keys);
+    void compactVertices();
     void computeVertexNormals();
+    void gradientNormalBlock(const int x_start, const int x_end, const int y_start, const int y_end, const int z_start, const int z_end);
+    Vector3 sampleGradient(const int xi, const int yi, const int zi) const;
+    void samplerGradientNormals(const size_t vertex_start, const size_t vertex_end);
+    void accumulateFaceNormals(const size_t index_start, const size_t index_end);
+    void gatherFaceNormals();
+    void triangleCornerNormals(const size_t i, Vector3* corners) const;
+    void normalizeVertexNormals(const size_t vertex_start, const size_t vertex_end);
 };
 
 }
\ No newline at end of file
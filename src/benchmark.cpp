@@ -68,15 +68,48 @@ TriangleStats MTVT::computeTriangleQualityStats(const Mesh& mesh)
     return stats;
 }
 
-pair<SummaryStats, Mesh> MTVT::runBenchmark(std::string name, int iterations, Vector3 min, Vector3 max, float cube_size, float(*sampler)(Vector3), float threshold, Builder::LatticeType lattice_type, Builder::ClusteringMode clustering_mode, unsigned short threads)
+pair<SummaryStats, Mesh> MTVT::runBenchmark(std::string name, int iterations, Vector3 min, Vector3 max, float cube_size, float(*sampler)(Vector3), float threshold, Builder::LatticeType lattice_type, Builder::ClusteringMode clustering_mode, unsigned short threads, Executor* executor)
 {
-    SummaryStats summary{ };
+    Builder builder;
+    try
+    {
+        builder.configure(min, max, cube_size, sampler, threshold);
+    }
+    catch (exception e)
+    {
+        cout << "exception during " << name << " benchmark:" << endl;
+        cout << e.what() << endl;
+        return { SummaryStats{ }, {} };
+    }
 
+    return runBenchmark(name, iterations, builder, lattice_type, clustering_mode, threads, executor);
+}
+
+pair<SummaryStats, Mesh> MTVT::runBenchmark(std::string name, int iterations, Vector3 min, Vector3 max, float cube_size, BatchSampler sampler, float threshold, Builder::LatticeType lattice_type, Builder::ClusteringMode clustering_mode, unsigned short threads, Executor* executor)
+{
     Builder builder;
     try
     {
         builder.configure(min, max, cube_size, sampler, threshold);
+    }
+    catch (exception e)
+    {
+        cout << "exception during " << name << " benchmark:" << endl;
+        cout << e.what() << endl;
+        return { SummaryStats{ }, {} };
+    }
+
+    return runBenchmark(name, iterations, builder, lattice_type, clustering_mode, threads, executor);
+}
+
+pair<SummaryStats, Mesh> MTVT::runBenchmark(std::string name, int iterations, Builder& builder, Builder::LatticeType lattice_type, Builder::ClusteringMode clustering_mode, unsigned short threads, Executor* executor)
+{
+    SummaryStats summary{ };
+
+    try
+    {
         builder.configureModes(lattice_type, clustering_mode, threads);
+        builder.setExecutor(executor);
     }
     catch (exception e)
     {
@@ -94,7 +127,7 @@ pair<SummaryStats, Mesh> MTVT::runBenchmark(std::string name, int iterations, Ve
         cout.flush();
         try
         {
-            mesh = builder.generate(stats);
+            builder.generateInto(mesh, stats);
         }
         catch (exception e)
         {
@@ -110,6 +143,8 @@ pair<SummaryStats, Mesh> MTVT::runBenchmark(std::string name, int iterations, Ve
 
     summary.vertices = stats.vertices;
     summary.vertices_bytes = sizeof(Vector3) * mesh.vertices.size() * 2;
+    summary.unreferenced_vertices = stats.unreferenced_vertices / iterations;
+    summary.unreferenced_vertices_percent = ((float)summary.unreferenced_vertices / ((float)stats.vertices + (float)summary.unreferenced_vertices)) * 100.0f;
     summary.triangles = stats.indices / 3;
     summary.indices = stats.indices;
     summary.indices_bytes = sizeof(VertexRef) * mesh.indices.size();
@@ -131,6 +166,8 @@ pair<SummaryStats, Mesh> MTVT::runBenchmark(std::string name, int iterations, Ve
     summary.tetrahedra_computed = stats.tetrahedra_evaluated;
     summary.tetrahedra_total = stats.max_tetrahedra;
     summary.tetrahedra_computed_percent = ((float)stats.tetrahedra_evaluated / (float)stats.max_tetrahedra) * 100.0f;
+    summary.cubes_skipped = stats.cubes_skipped / iterations;
+    summary.cubes_skipped_percent = ((float)summary.cubes_skipped / (float)(stats.cubes_x * stats.cubes_y * stats.cubes_z)) * 100.0f;
 
     double total_time = stats.allocation_time + stats.sampling_time + stats.vertex_time + stats.geometry_time;
     summary.time_total = total_time / iterations;
@@ -145,6 +182,22 @@ pair<SummaryStats, Mesh> MTVT::runBenchmark(std::string name, int iterations, Ve
     summary.time_normals = stats.normal_time / iterations;
     summary.percent_normals = (stats.normal_time / total_time) * 100.0f;
 
+    double busy_sum = 0, idle_sum = 0;
+    for (size_t w = 0; w < stats.sampling_busy_time.size(); ++w)
+    {
+        summary.sampling_busy_time.push_back(stats.sampling_busy_time[w] / iterations);
+        summary.sampling_idle_time.push_back(stats.sampling_idle_time[w] / iterations);
+        busy_sum += stats.sampling_busy_time[w];
+        idle_sum += stats.sampling_idle_time[w];
+    }
+    // the streaming and surface following modes don't split sampling into timed tiles, so have no times at all
+    summary.sampling_idle_percent = ((busy_sum + idle_sum) > 0.0) ? (idle_sum / (busy_sum + idle_sum)) * 100.0f : 0.0f;
+    summary.sampling_tiles = stats.sampling_tiles;
+    summary.sampling_tiles_stolen = stats.sampling_tiles_stolen / iterations;
+    summary.sampler_calls = stats.sampler_calls / iterations;
+    summary.sampler_calls_skipped = stats.sampler_calls_skipped / iterations;
+    summary.sampler_calls_skipped_percent = ((float)stats.sampler_calls_skipped / (float)(stats.sampler_calls + stats.sampler_calls_skipped)) * 100.0f;
+
     summary.degenerate_triangles = stats.degenerate_triangles;
     summary.degenerate_percent = ((float)stats.degenerate_triangles / ((float)summary.triangles + (float)stats.degenerate_triangles)) * 100.0f;
     summary.invalid_triangles = stats.invalid_triangles;
@@ -171,7 +224,8 @@ string MTVT::generateCSVLine(const SummaryStats& stats, bool title_line)
             "sample point bytes;edge bytes;vertex buffer bytes;index buffer bytes;"
             "sample point alloc relative;edge alloc relative;tetrahedra eval relative;"
             "discarded tri fraction;verts per SP; verts per edge;verts per tetrahedron;tris per SP;tris per edge;tris per tetrahedron;"
-            "tri area mean;tri area max;tri area min;tri area SD;tri AR mean;tri AR max;tri AR min;tri AR SD\n";
+            "tri area mean;tri area max;tri area min;tri area SD;tri AR mean;tri AR max;tri AR min;tri AR SD;"
+            "sampling idle %;sampling tiles;sampling tiles stolen;sampler calls;sampler calls skipped;sampler calls skipped %;cubes skipped;cubes skipped %;unreferenced vertices;unreferenced vertices %\n";
         return csv_file;
     }
     string csv_line =
@@ -183,7 +237,11 @@ string MTVT::generateCSVLine(const SummaryStats& stats, bool title_line)
         + format("{0};{1};{2};{3};", stats.sample_points_bytes, stats.edges_bytes, stats.vertices_bytes, stats.indices_bytes)
         + format("{0:>6f}%;{1:>6f}%;{2:>6f}%;", stats.sample_points_allocated_percent, stats.edges_allocated_percent, stats.tetrahedra_computed_percent)
         + format("{0:>6f}%;{1:>8f};{2:>8f};{3:>8f};{4:>8f};{5:>8f};{6:>8f};", stats.degenerate_percent, stats.verts_per_sp, stats.verts_per_edge, stats.verts_per_tet, stats.tris_per_sp, stats.tris_per_edge, stats.tris_per_tet)
-        + format("{0:>8f};{1:>8f};{2:>8f};{3:>8f};{4:>8f};{5:>8f};{6:>8f};{7:>8f}\n", stats.triangle_stats.area_mean, stats.triangle_stats.area_max, stats.triangle_stats.area_min, stats.triangle_stats.area_sd, stats.triangle_stats.aspect_mean, stats.triangle_stats.aspect_max, stats.triangle_stats.aspect_min, stats.triangle_stats.aspect_sd);
+        + format("{0:>8f};{1:>8f};{2:>8f};{3:>8f};{4:>8f};{5:>8f};{6:>8f};{7:>8f};", stats.triangle_stats.area_mean, stats.triangle_stats.area_max, stats.triangle_stats.area_min, stats.triangle_stats.area_sd, stats.triangle_stats.aspect_mean, stats.triangle_stats.aspect_max, stats.triangle_stats.aspect_min, stats.triangle_stats.aspect_sd)
+        + format("{0:5f}%;{1};{2};", stats.sampling_idle_percent, stats.sampling_tiles, stats.sampling_tiles_stolen)
+        + format("{0};{1};{2:5f}%;", stats.sampler_calls, stats.sampler_calls_skipped, stats.sampler_calls_skipped_percent)
+        + format("{0};{1:5f}%;", stats.cubes_skipped, stats.cubes_skipped_percent)
+        + format("{0};{1:5f}%\n", stats.unreferenced_vertices, stats.unreferenced_vertices_percent);
     return csv_line;
 }
 
@@ -196,16 +254,21 @@ void MTVT::printBenchmarkSummary(const SummaryStats& stats)
     cout << format(locale("en_US.UTF-8"), "    sample points:  {0:>12L} ({1:L} allocated)", stats.sample_points_theoretical, stats.sample_points_allocated) << endl;
     cout << format(locale("en_US.UTF-8"), "    edges:          {0:>12L} ({1:L} allocated)", stats.edges_theoretical, stats.edges_allocated) << endl;
     cout << format(locale("en_US.UTF-8"), "    tetrahedra:     {0:>12L} ({1:L} evaluated)", stats.tetrahedra_total, stats.tetrahedra_computed) << endl;
-    cout << format(locale("en_US.UTF-8"), "    vertices:       {0:>12L}", stats.vertices) << endl;
+    cout << format(locale("en_US.UTF-8"), "    cubes:          {0:>12L} ({1:L} skipped as empty, {2:5f}%)", stats.cubes_x * stats.cubes_y * stats.cubes_z, stats.cubes_skipped, stats.cubes_skipped_percent) << endl;
+    cout << format(locale("en_US.UTF-8"), "    vertices:       {0:>12L} ({1:L} unreferenced removed, {2:5f}%)", stats.vertices, stats.unreferenced_vertices, stats.unreferenced_vertices_percent) << endl;
     cout << format(locale("en_US.UTF-8"), "    triangles:      {0:>12L} ({1:L} indices)", stats.triangles, stats.indices) << endl;
     cout << format(locale("en_US.UTF-8"), "    degenerates:    {0:>12L}", stats.degenerate_triangles) << endl;
     cout << format(locale("en_US.UTF-8"), "    invalid:        {0:>12L}", stats.invalid_triangles) << endl;
+    cout << format(locale("en_US.UTF-8"), "    sampler calls:  {0:>12L} ({1:L} skipped, {2:5f}%)", stats.sampler_calls, stats.sampler_calls_skipped, stats.sampler_calls_skipped_percent) << endl;
     cout << format("  timing:           {0:.>6f}s total", stats.time_total) << endl;
     cout << format("    allocation:     {0:.>6f}s ({1:5f}% of total)", stats.time_allocation, stats.percent_allocation) << endl;
     cout << format("    sampling:       {0:.>6f}s ({1:5f}% of total)", stats.time_sampling, stats.percent_sampling) << endl;
     cout << format("    vertex:         {0:.>6f}s ({1:5f}% of total)", stats.time_vertex, stats.percent_vertex) << endl;
     cout << format("    geometry:       {0:.>6f}s ({1:5f}% of total)", stats.time_geometry, stats.percent_geometry) << endl;
     cout << format("    normals:        {0:.>6f}s ({1:5f}% of total)", stats.time_normals, stats.percent_normals) << endl;
+    cout << format("  sampling workers: {0:5f}% idle ({1} of {2} tiles stolen)", stats.sampling_idle_percent, stats.sampling_tiles_stolen, stats.sampling_tiles) << endl;
+    for (size_t w = 0; w < stats.sampling_busy_time.size(); ++w)
+        cout << format("    worker {0:>2}:      {1:.>6f}s busy, {2:.>6f}s idle", w, stats.sampling_busy_time[w], stats.sampling_idle_time[w]) << endl;
     cout <<        "  efficiency (lower number better):" << endl;
     cout << format("    SP allocation:  {0:>6f}% ({1})", stats.sample_points_allocated_percent, getMemorySize(stats.sample_points_bytes)) << endl;
     cout << format("    E allocation:   {0:>6f}% ({1})", stats.edges_allocated_percent, getMemorySize(stats.edges_bytes)) << endl;
@@ -232,6 +295,17 @@ void MTVT::printBenchmarkSummary(const SummaryStats& stats)
     cout <<        "----------------------------------------" << endl << endl;
 }
 
+void MTVT::printSpeedupSummary(const SummaryStats& baseline, const SummaryStats& stats)
+{
+    cout <<        "-- speedup -----------------------------" << endl;
+    cout << format("  {0} vs {1}", stats.name, baseline.name) << endl;
+    cout << format("    total:          {0:.>6f}s -> {1:.>6f}s ({2:.2f}x)", baseline.time_total, stats.time_total, baseline.time_total / stats.time_total) << endl;
+    cout << format("    sampling:       {0:.>6f}s -> {1:.>6f}s ({2:.2f}x)", baseline.time_sampling, stats.time_sampling, baseline.time_sampling / stats.time_sampling) << endl;
+    cout << format("    vertex:         {0:.>6f}s -> {1:.>6f}s ({2:.2f}x)", baseline.time_vertex, stats.time_vertex, baseline.time_vertex / stats.time_vertex) << endl;
+    cout << format("    geometry:       {0:.>6f}s -> {1:.>6f}s ({2:.2f}x)", baseline.time_geometry, stats.time_geometry, baseline.time_geometry / stats.time_geometry) << endl;
+    cout <<        "----------------------------------------" << endl << endl;
+}
+
 void MTVT::dumpMeshToOBJ(const Mesh& mesh, std::string name)
 {
     ofstream file("out/" + name + ".obj");
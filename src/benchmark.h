@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include "MTVT.h"
 
@@ -29,6 +30,8 @@ struct SummaryStats
 
     // mesh stats
     size_t vertices, vertices_bytes;
+    size_t unreferenced_vertices;
+    float unreferenced_vertices_percent;
     size_t triangles, indices, indices_bytes;
 
     // generation parameters/stats
@@ -40,6 +43,8 @@ struct SummaryStats
     float edges_allocated_percent;
     size_t tetrahedra_computed, tetrahedra_total;
     float tetrahedra_computed_percent;
+    size_t cubes_skipped;
+    float cubes_skipped_percent;
 
     // timing stats
     double time_total;
@@ -49,6 +54,13 @@ struct SummaryStats
     double time_geometry, percent_geometry;
     double time_normals, percent_normals;
 
+    // sampling load balance stats
+    std::vector<double> sampling_busy_time, sampling_idle_time;
+    double sampling_idle_percent;
+    size_t sampling_tiles, sampling_tiles_stolen;
+    size_t sampler_calls, sampler_calls_skipped;
+    float sampler_calls_skipped_percent;
+
     // geometry stats
     size_t degenerate_triangles;
     float degenerate_percent;
@@ -59,9 +71,14 @@ struct SummaryStats
 };
 
 TriangleStats computeTriangleQualityStats(const Mesh& mesh);
-std::pair<SummaryStats, Mesh> runBenchmark(std::string name, int iterations, Vector3 min, Vector3 max, float cube_size, float (*sampler)(Vector3), float threshold, Builder::LatticeType lattice_type, Builder::ClusteringMode clustering_mode, unsigned short threads);
+std::pair<SummaryStats, Mesh> runBenchmark(std::string name, int iterations, Vector3 min, Vector3 max, float cube_size, float (*sampler)(Vector3), float threshold, Builder::LatticeType lattice_type, Builder::ClusteringMode clustering_mode, unsigned short threads, Executor* executor = nullptr);
+std::pair<SummaryStats, Mesh> runBenchmark(std::string name, int iterations, Vector3 min, Vector3 max, float cube_size, BatchSampler sampler, float threshold, Builder::LatticeType lattice_type, Builder::ClusteringMode clustering_mode, unsigned short threads, Executor* executor = nullptr);
+// runs the benchmark on a builder which has already been configured with a volume and sampler
+std::pair<SummaryStats, Mesh> runBenchmark(std::string name, int iterations, Builder& builder, Builder::LatticeType lattice_type, Builder::ClusteringMode clustering_mode, unsigned short threads, Executor* executor = nullptr);
 std::string generateCSVLine(const SummaryStats& stats, bool title_line = false);
 void printBenchmarkSummary(const SummaryStats& stats);
+// compares the timings of two runs of the same scenario, e.g. a scalar and a batched sampler
+void printSpeedupSummary(const SummaryStats& baseline, const SummaryStats& stats);
 std::string getMemorySize(size_t bytes);
 void dumpMeshToOBJ(const Mesh& mesh, std::string name);
 
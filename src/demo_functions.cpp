@@ -15,6 +15,23 @@ float fbmFunc(Vector3 v)
     return fbm(v * 2.0f, 3, 2.0f, 0.5f);
 }
 
+// batched equivalent of fbmFunc, for use with the BatchSampler overload of configure
+void fbmBatchFunc(const Vector3* positions, float* values, size_t count)
+{
+    Vector3 coords[8];
+    float results[8];
+    for (size_t i = 0; i < count; i += 8)
+    {
+        size_t n = min(count - i, (size_t)8);
+        // pad a partial final block by repeating the last position
+        for (size_t j = 0; j < 8; ++j)
+            coords[j] = positions[i + min(j, n - 1)] * 2.0f;
+        fbm8(coords, results, 3, 2.0f, 0.5f);
+        for (size_t j = 0; j < n; ++j)
+            values[i + j] = results[j];
+    }
+}
+
 float bumpFunc(Vector3 v)
 {
     return (1.0f / ((v.x * v.x) + (v.y * v.y) + 1)) - v.z;
@@ -25,3 +42,86 @@ float cubeFunc(Vector3 v)
     Vector3 q = abs(v) - Vector3{ 1.0f, 1.0f, 1.0f };
     return -(mag(max(q, Vector3{ 0.0f, 0.0f, 0.0f })) + min(max(q.x, max(q.y, q.z)), 0.0f));
 }
+
+// adapts a function which returns the value and writes the gradient to the GradientSampler signature
+template <float (*func)(Vector3, Vector3&)>
+static void gradientBatch(const Vector3* positions, float* values, Vector3* gradients, size_t count)
+{
+    Vector3 unused;
+    for (size_t i = 0; i < count; ++i)
+        values[i] = func(positions[i], (gradients != nullptr) ? gradients[i] : unused);
+}
+
+static float sphereGradient(Vector3 v, Vector3& gradient)
+{
+    const float length = mag(v);
+    // there's no gradient at the center, so just point it somewhere rather than dividing by zero
+    gradient = (length > 0.0f) ? (v / -length) : Vector3{ 0.0f, 0.0f, -1.0f };
+    return 1.0f - length;
+}
+
+static float bumpGradient(Vector3 v, Vector3& gradient)
+{
+    const float d = (v.x * v.x) + (v.y * v.y) + 1;
+    gradient = Vector3{ (-2.0f * v.x) / (d * d), (-2.0f * v.y) / (d * d), -1.0f };
+    return (1.0f / d) - v.z;
+}
+
+static float cubeGradient(Vector3 v, Vector3& gradient)
+{
+    Vector3 q = abs(v) - Vector3{ 1.0f, 1.0f, 1.0f };
+    const Vector3 outside = max(q, Vector3{ 0.0f, 0.0f, 0.0f });
+    const float outside_length = mag(outside);
+    const Vector3 sign{ (v.x < 0.0f) ? -1.0f : 1.0f, (v.y < 0.0f) ? -1.0f : 1.0f, (v.z < 0.0f) ? -1.0f : 1.0f };
+    if (outside_length > 0.0f)
+        gradient = (sign * outside) / -outside_length;
+    else if (q.x >= q.y && q.x >= q.z)
+        gradient = Vector3{ -sign.x, 0.0f, 0.0f };
+    else if (q.y >= q.z)
+        gradient = Vector3{ 0.0f, -sign.y, 0.0f };
+    else
+        gradient = Vector3{ 0.0f, 0.0f, -sign.z };
+    return -(outside_length + min(max(q.x, max(q.y, q.z)), 0.0f));
+}
+
+void sphereGradientFunc(const Vector3* positions, float* values, Vector3* gradients, size_t count)
+{
+    gradientBatch<sphereGradient>(positions, values, gradients, count);
+}
+
+void fbmGradientFunc(const Vector3* positions, float* values, Vector3* gradients, size_t count)
+{
+    // the sampling pass only wants values, which fbm8 gives without working out the gradients.
+    // fbm_grad8 gives the same values, so they don't depend on whether gradients were asked for
+    if (gradients == nullptr)
+    {
+        fbmBatchFunc(positions, values, count);
+        return;
+    }
+    Vector3 coords[8];
+    float results[8];
+    Vector3 results_gradients[8];
+    for (size_t i = 0; i < count; i += 8)
+    {
+        size_t n = min(count - i, (size_t)8);
+        // pad a partial final block by repeating the last position
+        for (size_t j = 0; j < 8; ++j)
+            coords[j] = positions[i + min(j, n - 1)] * 2.0f;
+        fbm_grad8(coords, results, results_gradients, 3, 2.0f, 0.5f);
+        for (size_t j = 0; j < n; ++j)
+        {
+            values[i + j] = results[j];
+            gradients[i + j] = results_gradients[j] * 2.0f;
+        }
+    }
+}
+
+void bumpGradientFunc(const Vector3* positions, float* values, Vector3* gradients, size_t count)
+{
+    gradientBatch<bumpGradient>(positions, values, gradients, count);
+}
+
+void cubeGradientFunc(const Vector3* positions, float* values, Vector3* gradients, size_t count)
+{
+    gradientBatch<cubeGradient>(positions, values, gradients, count);
+}
@@ -4,5 +4,12 @@
 
 float sphereFunc(MTVT::Vector3 v);
 float fbmFunc(MTVT::Vector3 v);
+void fbmBatchFunc(const MTVT::Vector3* positions, float* values, size_t count);
 float bumpFunc(MTVT::Vector3 v);
-float cubeFunc(MTVT::Vector3 v);
\ No newline at end of file
+float cubeFunc(MTVT::Vector3 v);
+
+// versions of the above which can also give analytic gradients, for use with the GradientSampler overload of configure
+void sphereGradientFunc(const MTVT::Vector3* positions, float* values, MTVT::Vector3* gradients, size_t count);
+void fbmGradientFunc(const MTVT::Vector3* positions, float* values, MTVT::Vector3* gradients, size_t count);
+void bumpGradientFunc(const MTVT::Vector3* positions, float* values, MTVT::Vector3* gradients, size_t count);
+void cubeGradientFunc(const MTVT::Vector3* positions, float* values, MTVT::Vector3* gradients, size_t count);
\ No newline at end of file
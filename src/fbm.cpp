@@ -1,5 +1,16 @@
 #include "fbm.h"
 
+// the hash in fbm_random scales a sine by 43758.5 and keeps the fraction, so fusing any of the
+// multiplies and adds leading up to it changes the noise completely, and the batched version
+// below would no longer follow the scalar one. keep the compiler from contracting them
+#if defined(_MSC_VER)
+#pragma fp_contract (off)
+#elif defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize ("fp-contract=off")
+#endif
+
 using namespace MTVT;
 
 float fbm_random(Vector3 coord)
@@ -62,4 +73,347 @@ float fbm(Vector3 _coord, int _octaves, float _lacunarity, float _gain)
     v /= max_amplitude;
 
     return v;
-}
\ No newline at end of file
+}
+
+float fbm_noise_grad(Vector3 coord, Vector3& gradient)
+{
+    Vector3 flr = floor(coord);
+    Vector3 frc = fract(coord);
+
+    float tln = fbm_random(flr + Vector3{ 0, 0, 0 });
+    float trn = fbm_random(flr + Vector3{ 1, 0, 0 });
+    float bln = fbm_random(flr + Vector3{ 0, 1, 0 });
+    float brn = fbm_random(flr + Vector3{ 1, 1, 0 });
+    float tlf = fbm_random(flr + Vector3{ 0, 0, 1 });
+    float trf = fbm_random(flr + Vector3{ 1, 0, 1 });
+    float blf = fbm_random(flr + Vector3{ 0, 1, 1 });
+    float brf = fbm_random(flr + Vector3{ 1, 1, 1 });
+
+    // the smoothstep weights, and their derivatives 6f(1 - f)
+    Vector3 m = frc * frc * (Vector3{ 3.0f, 3.0f, 3.0f } - (Vector3{ 2.0f, 2.0f, 2.0f } * frc));
+    Vector3 dm = frc * (Vector3{ 1.0f, 1.0f, 1.0f } - frc) * 6.0f;
+
+    float tn = lerp(tln, trn, m.x);
+    float bn = lerp(bln, brn, m.x);
+    float tf = lerp(tlf, trf, m.x);
+    float bf = lerp(blf, brf, m.x);
+    float n = lerp(tn, bn, m.y);
+    float f = lerp(tf, bf, m.y);
+    float result = lerp(n, f, m.z);
+
+    // differentiate the trilinear blend one axis at a time, holding the other two weights
+    gradient.x = lerp(lerp(trn - tln, brn - bln, m.y), lerp(trf - tlf, brf - blf, m.y), m.z) * dm.x * 2.0f;
+    gradient.y = lerp(bn - tn, bf - tf, m.z) * dm.y * 2.0f;
+    gradient.z = (f - n) * dm.z * 2.0f;
+
+    return (result * 2.0f) - 1.0f;
+}
+
+float fbm_grad(Vector3 _coord, int _octaves, float _lacunarity, float _gain, Vector3& _gradient)
+{
+    float amplitude = 1.0f;
+    float frequency = 1.0f;
+
+    float max_amplitude = 0.0f;
+
+    float v = 0.0f;
+    _gradient = Vector3{ 0.0f, 0.0f, 0.0f };
+
+    for (int i = 0; i < _octaves; i++)
+    {
+        Vector3 octave_gradient;
+        v += fbm_noise_grad(_coord * frequency, octave_gradient) * amplitude;
+        // each octave is sampled at a scaled coordinate, so its gradient scales with the frequency too
+        _gradient += octave_gradient * (amplitude * frequency);
+        frequency *= _lacunarity;
+        max_amplitude += amplitude;
+        amplitude *= _gain;
+    }
+
+    v /= max_amplitude;
+    _gradient /= max_amplitude;
+
+    return v;
+}
+
+// vectorised versions of fbm_noise and fbm, which evaluate 8 positions at once. the
+// float arithmetic is done in the same order as the scalar code, but the sine inside
+// the hash is evaluated in double precision and rounded to float, which doesn't always
+// round the same way as the C runtime's sinf. the hash amplifies that last bit, so the
+// results aren't bit-identical to fbm: around 1 in 6 points differ. see FBM_BATCH_TOLERANCE
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+typedef __m256 vfloat;
+typedef __m256d vdouble;
+#define VF_WIDTH 8
+#define VD_WIDTH 4
+
+#define vf_set1 _mm256_set1_ps
+#define vf_add _mm256_add_ps
+#define vf_sub _mm256_sub_ps
+#define vf_mul _mm256_mul_ps
+#define vf_div _mm256_div_ps
+#define vf_floor _mm256_floor_ps
+#define vd_set1 _mm256_set1_pd
+#define vd_add _mm256_add_pd
+#define vd_sub _mm256_sub_pd
+#define vd_mul _mm256_mul_pd
+#define vd_xor _mm256_xor_pd
+#define vd_sign_from_low_bit(d) _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_and_si256(_mm256_castpd_si256(d), _mm256_set1_epi64x(1)), 63))
+
+static inline vfloat vf_set(const float* f) { return _mm256_loadu_ps(f); }
+static inline void vf_store(float* f, vfloat v) { _mm256_storeu_ps(f, v); }
+static inline vdouble vf_to_vd(vfloat f, int half) { return _mm256_cvtps_pd(half ? _mm256_extractf128_ps(f, 1) : _mm256_castps256_ps128(f)); }
+static inline vfloat vd_to_vf(const vdouble* d) { return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(d[0])), _mm256_cvtpd_ps(d[1]), 1); }
+
+#else
+
+#include <emmintrin.h>
+
+// SSE2 version, for builds which don't target AVX2. the project itself
+// compiles everything for AVX2, so there's no runtime fallback to this
+typedef __m128 vfloat;
+typedef __m128d vdouble;
+#define VF_WIDTH 4
+#define VD_WIDTH 2
+
+#define vf_set1 _mm_set1_ps
+#define vf_add _mm_add_ps
+#define vf_sub _mm_sub_ps
+#define vf_mul _mm_mul_ps
+#define vf_div _mm_div_ps
+#define vd_set1 _mm_set1_pd
+#define vd_add _mm_add_pd
+#define vd_sub _mm_sub_pd
+#define vd_mul _mm_mul_pd
+#define vd_xor _mm_xor_pd
+#define vd_sign_from_low_bit(d) _mm_castsi128_pd(_mm_slli_epi64(_mm_and_si128(_mm_castpd_si128(d), _mm_set1_epi64x(1)), 63))
+
+// SSE2 has no floor, so truncate and correct the negative values
+static inline vfloat vf_floor(vfloat v)
+{
+    vfloat t = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+    return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, v), _mm_set1_ps(1.0f)));
+}
+static inline vfloat vf_set(const float* f) { return _mm_loadu_ps(f); }
+static inline void vf_store(float* f, vfloat v) { _mm_storeu_ps(f, v); }
+static inline vdouble vf_to_vd(vfloat f, int half) { return _mm_cvtps_pd(half ? _mm_movehl_ps(f, f) : f); }
+static inline vfloat vd_to_vf(const vdouble* d) { return _mm_movelh_ps(_mm_cvtpd_ps(d[0]), _mm_cvtpd_ps(d[1])); }
+
+#endif
+
+// double precision sine. reduces the argument to [-pi/2, pi/2] using a two-part
+// pi (the first part has enough trailing zeroes that k * pi_a is exact), then
+// evaluates the taylor series, which is accurate to ~1e-16 over that range
+static inline vdouble vd_sin(vdouble x)
+{
+    const vdouble round_magic = vd_set1(6755399441055744.0);
+    vdouble kr = vd_add(vd_mul(x, vd_set1(0.318309886183790671538)), round_magic);
+    vdouble k = vd_sub(kr, round_magic);
+    vdouble r = vd_sub(x, vd_mul(k, vd_set1(3.14159265346825122834)));
+    r = vd_sub(r, vd_mul(k, vd_set1(1.215420101301238449864e-10)));
+
+    vdouble r2 = vd_mul(r, r);
+    vdouble p = vd_set1(1.0 / 51090942171709440000.0);
+    p = vd_add(vd_mul(p, r2), vd_set1(-1.0 / 121645100408832000.0));
+    p = vd_add(vd_mul(p, r2), vd_set1(1.0 / 355687428096000.0));
+    p = vd_add(vd_mul(p, r2), vd_set1(-1.0 / 1307674368000.0));
+    p = vd_add(vd_mul(p, r2), vd_set1(1.0 / 6227020800.0));
+    p = vd_add(vd_mul(p, r2), vd_set1(-1.0 / 39916800.0));
+    p = vd_add(vd_mul(p, r2), vd_set1(1.0 / 362880.0));
+    p = vd_add(vd_mul(p, r2), vd_set1(-1.0 / 5040.0));
+    p = vd_add(vd_mul(p, r2), vd_set1(1.0 / 120.0));
+    p = vd_add(vd_mul(p, r2), vd_set1(-1.0 / 6.0));
+    vdouble s = vd_add(r, vd_mul(vd_mul(p, r2), r));
+
+    // sin(x) = -sin(x - k*pi) for odd k. the low bit of the rounded value is k's parity
+    return vd_xor(s, vd_sign_from_low_bit(kr));
+}
+
+static inline vfloat vf_sin(vfloat x)
+{
+    vdouble d[VF_WIDTH / VD_WIDTH];
+    for (int h = 0; h < VF_WIDTH / VD_WIDTH; ++h)
+        d[h] = vd_sin(vf_to_vd(x, h));
+    return vd_to_vf(d);
+}
+
+static inline vfloat fbm_random_v(vfloat x, vfloat y, vfloat z)
+{
+    vfloat dot = vf_add(vf_add(vf_mul(x, vf_set1(12.98f)), vf_mul(y, vf_set1(78.23f))), vf_mul(z, vf_set1(35.63f)));
+    vfloat f = vf_mul(vf_sin(dot), vf_set1(43758.5f));
+    return vf_sub(f, vf_floor(f));
+}
+
+static inline vfloat vf_lerp(vfloat a, vfloat b, vfloat x)
+{
+    return vf_add(a, vf_mul(vf_sub(b, a), x));
+}
+
+static inline vfloat fbm_noise_v(vfloat x, vfloat y, vfloat z)
+{
+    const vfloat one = vf_set1(1.0f);
+    vfloat fx = vf_floor(x), fy = vf_floor(y), fz = vf_floor(z);
+    vfloat rx = vf_sub(x, fx), ry = vf_sub(y, fy), rz = vf_sub(z, fz);
+    vfloat fx1 = vf_add(fx, one), fy1 = vf_add(fy, one), fz1 = vf_add(fz, one);
+
+    vfloat tln = fbm_random_v(fx,  fy,  fz);
+    vfloat trn = fbm_random_v(fx1, fy,  fz);
+    vfloat bln = fbm_random_v(fx,  fy1, fz);
+    vfloat brn = fbm_random_v(fx1, fy1, fz);
+    vfloat tlf = fbm_random_v(fx,  fy,  fz1);
+    vfloat trf = fbm_random_v(fx1, fy,  fz1);
+    vfloat blf = fbm_random_v(fx,  fy1, fz1);
+    vfloat brf = fbm_random_v(fx1, fy1, fz1);
+
+    const vfloat three = vf_set1(3.0f), two = vf_set1(2.0f);
+    vfloat mx = vf_mul(vf_mul(rx, rx), vf_sub(three, vf_mul(two, rx)));
+    vfloat my = vf_mul(vf_mul(ry, ry), vf_sub(three, vf_mul(two, ry)));
+    vfloat mz = vf_mul(vf_mul(rz, rz), vf_sub(three, vf_mul(two, rz)));
+
+    vfloat result =
+        vf_lerp(
+            vf_lerp(vf_lerp(tln, trn, mx), vf_lerp(bln, brn, mx), my),
+            vf_lerp(vf_lerp(tlf, trf, mx), vf_lerp(blf, brf, mx), my),
+            mz
+        );
+
+    return vf_sub(vf_mul(result, two), one);
+}
+
+// as fbm_noise_v, but also writing the gradient, in the same way as fbm_noise_grad. the result
+// is computed exactly as in fbm_noise_v, so the values match fbm8
+static inline vfloat fbm_noise_grad_v(vfloat x, vfloat y, vfloat z, vfloat& gx, vfloat& gy, vfloat& gz)
+{
+    const vfloat one = vf_set1(1.0f);
+    vfloat fx = vf_floor(x), fy = vf_floor(y), fz = vf_floor(z);
+    vfloat rx = vf_sub(x, fx), ry = vf_sub(y, fy), rz = vf_sub(z, fz);
+    vfloat fx1 = vf_add(fx, one), fy1 = vf_add(fy, one), fz1 = vf_add(fz, one);
+
+    vfloat tln = fbm_random_v(fx,  fy,  fz);
+    vfloat trn = fbm_random_v(fx1, fy,  fz);
+    vfloat bln = fbm_random_v(fx,  fy1, fz);
+    vfloat brn = fbm_random_v(fx1, fy1, fz);
+    vfloat tlf = fbm_random_v(fx,  fy,  fz1);
+    vfloat trf = fbm_random_v(fx1, fy,  fz1);
+    vfloat blf = fbm_random_v(fx,  fy1, fz1);
+    vfloat brf = fbm_random_v(fx1, fy1, fz1);
+
+    // the smoothstep weights, and their derivatives 6f(1 - f)
+    const vfloat three = vf_set1(3.0f), two = vf_set1(2.0f), six = vf_set1(6.0f);
+    vfloat mx = vf_mul(vf_mul(rx, rx), vf_sub(three, vf_mul(two, rx)));
+    vfloat my = vf_mul(vf_mul(ry, ry), vf_sub(three, vf_mul(two, ry)));
+    vfloat mz = vf_mul(vf_mul(rz, rz), vf_sub(three, vf_mul(two, rz)));
+    vfloat dmx = vf_mul(vf_mul(rx, vf_sub(one, rx)), six);
+    vfloat dmy = vf_mul(vf_mul(ry, vf_sub(one, ry)), six);
+    vfloat dmz = vf_mul(vf_mul(rz, vf_sub(one, rz)), six);
+
+    vfloat tn = vf_lerp(tln, trn, mx);
+    vfloat bn = vf_lerp(bln, brn, mx);
+    vfloat tf = vf_lerp(tlf, trf, mx);
+    vfloat bf = vf_lerp(blf, brf, mx);
+    vfloat n = vf_lerp(tn, bn, my);
+    vfloat f = vf_lerp(tf, bf, my);
+    vfloat result = vf_lerp(n, f, mz);
+
+    gx = vf_mul(vf_mul(vf_lerp(vf_lerp(vf_sub(trn, tln), vf_sub(brn, bln), my), vf_lerp(vf_sub(trf, tlf), vf_sub(brf, blf), my), mz), dmx), two);
+    gy = vf_mul(vf_mul(vf_lerp(vf_sub(bn, tn), vf_sub(bf, tf), mz), dmy), two);
+    gz = vf_mul(vf_mul(vf_sub(f, n), dmz), two);
+
+    return vf_sub(vf_mul(result, two), one);
+}
+
+// splits 8 positions into per-axis lanes
+static inline void fbm_load_lanes(const Vector3* coords, int first, vfloat& x, vfloat& y, vfloat& z)
+{
+    float xs[VF_WIDTH], ys[VF_WIDTH], zs[VF_WIDTH];
+    for (int i = 0; i < VF_WIDTH; ++i)
+    {
+        xs[i] = coords[first + i].x;
+        ys[i] = coords[first + i].y;
+        zs[i] = coords[first + i].z;
+    }
+    x = vf_set(xs); y = vf_set(ys); z = vf_set(zs);
+}
+
+void fbm_noise8(const Vector3* coords, float* out)
+{
+    for (int first = 0; first < 8; first += VF_WIDTH)
+    {
+        vfloat x, y, z;
+        fbm_load_lanes(coords, first, x, y, z);
+        vf_store(out + first, fbm_noise_v(x, y, z));
+    }
+}
+
+void fbm8(const Vector3* _coords, float* _out, int _octaves, float _lacunarity, float _gain)
+{
+    for (int first = 0; first < 8; first += VF_WIDTH)
+    {
+        vfloat x, y, z;
+        fbm_load_lanes(_coords, first, x, y, z);
+
+        float amplitude = 1.0f;
+        float frequency = 1.0f;
+
+        float max_amplitude = 0.0f;
+
+        vfloat v = vf_set1(0.0f);
+
+        for (int i = 0; i < _octaves; i++)
+        {
+            vfloat f = vf_set1(frequency);
+            vfloat n = fbm_noise_v(vf_mul(x, f), vf_mul(y, f), vf_mul(z, f));
+            v = vf_add(v, vf_mul(n, vf_set1(amplitude)));
+            frequency *= _lacunarity;
+            max_amplitude += amplitude;
+            amplitude *= _gain;
+        }
+
+        vf_store(_out + first, vf_div(v, vf_set1(max_amplitude)));
+    }
+}
+
+void fbm_grad8(const Vector3* _coords, float* _out, Vector3* _gradients, int _octaves, float _lacunarity, float _gain)
+{
+    for (int first = 0; first < 8; first += VF_WIDTH)
+    {
+        vfloat x, y, z;
+        fbm_load_lanes(_coords, first, x, y, z);
+
+        float amplitude = 1.0f;
+        float frequency = 1.0f;
+
+        float max_amplitude = 0.0f;
+
+        vfloat v = vf_set1(0.0f);
+        vfloat gx = vf_set1(0.0f), gy = vf_set1(0.0f), gz = vf_set1(0.0f);
+
+        for (int i = 0; i < _octaves; i++)
+        {
+            vfloat f = vf_set1(frequency);
+            vfloat ogx, ogy, ogz;
+            vfloat n = fbm_noise_grad_v(vf_mul(x, f), vf_mul(y, f), vf_mul(z, f), ogx, ogy, ogz);
+            v = vf_add(v, vf_mul(n, vf_set1(amplitude)));
+            // each octave is sampled at a scaled coordinate, so its gradient scales with the frequency too
+            vfloat scale = vf_set1(amplitude * frequency);
+            gx = vf_add(gx, vf_mul(ogx, scale));
+            gy = vf_add(gy, vf_mul(ogy, scale));
+            gz = vf_add(gz, vf_mul(ogz, scale));
+            frequency *= _lacunarity;
+            max_amplitude += amplitude;
+            amplitude *= _gain;
+        }
+
+        vfloat m = vf_set1(max_amplitude);
+        vf_store(_out + first, vf_div(v, m));
+        float xs[VF_WIDTH], ys[VF_WIDTH], zs[VF_WIDTH];
+        vf_store(xs, vf_div(gx, m));
+        vf_store(ys, vf_div(gy, m));
+        vf_store(zs, vf_div(gz, m));
+        for (int i = 0; i < VF_WIDTH; ++i)
+            _gradients[first + i] = Vector3{ xs[i], ys[i], zs[i] };
+    }
+}
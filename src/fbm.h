@@ -6,4 +6,28 @@ float fbm_random(MTVT::Vector3 coord);
 
 float fbm_noise(MTVT::Vector3 coord);
 
-float fbm(MTVT::Vector3 _coord, int _octaves, float _lacunarity, float _gain);
\ No newline at end of file
+float fbm(MTVT::Vector3 _coord, int _octaves, float _lacunarity, float _gain);
+
+// the same as fbm_noise and fbm, but also writing the analytic gradient of the result
+// with respect to the coordinate. the values are identical to the plain versions
+float fbm_noise_grad(MTVT::Vector3 coord, MTVT::Vector3& gradient);
+
+float fbm_grad(MTVT::Vector3 _coord, int _octaves, float _lacunarity, float _gain, MTVT::Vector3& _gradient);
+
+// batched versions, evaluating exactly 8 coordinates per call using AVX2, or SSE2 when not compiled
+// for AVX2. these sample the same noise as fbm_noise and fbm, but not bit-for-bit (see fbm.cpp)
+void fbm_noise8(const MTVT::Vector3* coords, float* out);
+
+void fbm8(const MTVT::Vector3* _coords, float* _out, int _octaves, float _lacunarity, float _gain);
+
+// batched fbm_grad. the values are identical to fbm8, and the gradients follow fbm_grad
+void fbm_grad8(const MTVT::Vector3* _coords, float* _out, MTVT::Vector3* _gradients, int _octaves, float _lacunarity, float _gain);
+
+// largest difference between fbm8 and fbm (3 octaves, lacunarity 2, gain 0.5, as in the demo
+// functions) for coordinates within FBM_BATCH_TOLERANCE_RANGE of the origin on each axis. the
+// benchmark checks it over a fixed set of points before timing anything; the worst seen is ~2.2e-3.
+// further out, the scaled sines in the hash can round either side of an integer, and single points
+// can then differ by 0.5 or more. values close to the threshold can change sign either way, so
+// meshes of the two can differ in topology, not just in vertex positions
+#define FBM_BATCH_TOLERANCE 4e-3f
+#define FBM_BATCH_TOLERANCE_RANGE 2.0f
@@ -451,6 +451,7 @@ void GraphicsEnv::drawImGui()
             ImGui::LabelText("edges (ideal)", format(locale("en_US.UTF-8"), "{0:L} ({1:.2f}%% stored)", summary_stats.edges_theoretical, summary_stats.edges_allocated_percent).c_str());
             ImGui::LabelText("tetrahedra", format(locale("en_US.UTF-8"), "{0:L}", summary_stats.tetrahedra_computed).c_str());
             ImGui::LabelText("tetrahedra (total)", format(locale("en_US.UTF-8"), "{0:L} ({1:.2f}%% computed)", summary_stats.tetrahedra_total, summary_stats.tetrahedra_computed_percent).c_str());
+            ImGui::LabelText("cubes skipped", format(locale("en_US.UTF-8"), "{0:L} ({1:.2f}%% of total)", summary_stats.cubes_skipped, summary_stats.cubes_skipped_percent).c_str());
         }
 
         if (ImGui::CollapsingHeader("timing stats", ImGuiTreeNodeFlags_DefaultOpen | ImGuiTreeNodeFlags_Framed))
@@ -467,6 +468,7 @@ void GraphicsEnv::drawImGui()
         if (ImGui::CollapsingHeader("geometry stats", nullptr, ImGuiTreeNodeFlags_DefaultOpen | ImGuiTreeNodeFlags_Framed))
         {
             ImGui::LabelText("degenerate tris", "%d (%.3f%% of total)", summary_stats.degenerate_triangles, summary_stats.degenerate_percent);
+            ImGui::LabelText("unreferenced verts", format(locale("en_US.UTF-8"), "{0:L} ({1:.2f}%% removed)", summary_stats.unreferenced_vertices, summary_stats.unreferenced_vertices_percent).c_str());
             ImGui::Separator();
             ImGui::LabelText("verts / sp", "%.8f", summary_stats.verts_per_sp);
             ImGui::LabelText("verts / edge", "%.8f", summary_stats.verts_per_edge);
@@ -560,7 +562,7 @@ void GraphicsEnv::drawImGui()
         {
             // run the generator!
             static float(*funcs[5])(MTVT::Vector3) = { sphereFunc, bumpFunc, fbmFunc, cubeFunc, sphereFunc };
-            auto result = MTVT::runBenchmark("-", 1, param_min + param_off, param_max + param_off, param_resolution, funcs[param_function], param_threshold, (MTVT::Builder::LatticeType)param_lattice, (MTVT::Builder::ClusteringMode)param_merging, 8);
+            auto result = MTVT::runBenchmark("-", 1, param_min + param_off, param_max + param_off, param_resolution, funcs[param_function], param_threshold, (MTVT::Builder::LatticeType)param_lattice, (MTVT::Builder::ClusteringMode)param_merging, 8, &worker_pool);
             setSummary(result.first);
             setMesh(result.second, param_off);
         }
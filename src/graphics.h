@@ -52,6 +52,9 @@ private:
 
 	MTVT::SummaryStats summary_stats;
 
+	// kept alive between generations so live updates don't pay for thread creation
+	MTVT::ThreadPool worker_pool{ 8 };
+
 	// generation parameters
 	bool update_live = true;
 	MTVT::Vector3 param_min = { -1, -1, -1 };
@@ -9,14 +9,158 @@
 #include "benchmark.h"
 #include "graphics.h"
 #include "demo_functions.h"
+#include "fbm.h"
 
 using namespace std;
 using namespace MTVT;
 
-MappedMesh bunny_mesh;
+// the largest difference between the batched and scalar fbm over a fixed set of points covering the
+// range FBM_BATCH_TOLERANCE is stated for. the points follow a low discrepancy sequence, so they
+// spread evenly over the range without any of them lining up with the noise's integer lattice
+static float fbmBatchError()
+{
+    const double alpha[3] = { 0.8191725133961645, 0.6710436067037893, 0.5497004779019703 };
+    float max_error = 0.0f;
+    Vector3 coords[8];
+    float values[8];
+    for (int i = 0; i < (1 << 20); i += 8)
+    {
+        for (int j = 0; j < 8; ++j)
+        {
+            float c[3];
+            for (int a = 0; a < 3; ++a)
+            {
+                const double u = 0.5 + (alpha[a] * (i + j + 1));
+                c[a] = static_cast<float>(((u - floor(u)) * 2.0) - 1.0) * FBM_BATCH_TOLERANCE_RANGE;
+            }
+            coords[j] = Vector3{ c[0], c[1], c[2] };
+        }
+        fbm8(coords, values, 3, 2.0f, 0.5f);
+        for (int j = 0; j < 8; ++j)
+            max_error = max(max_error, fabs(values[j] - fbm(coords[j], 3, 2.0f, 0.5f)));
+    }
+    return max_error;
+}
 
-int main()
+// headless benchmark run, comparing the scalar and batched fbm samplers, vertex compaction, sampled, analytic
+// and angle weighted normals, a sphere SDF through a function pointer vs an inlined lambda and full vs
+// lipschitz-bounded, streaming and surface following storage, and untiled vs tiled traversal at several resolutions
+static int benchmarkMain()
 {
+    try
+    {
+        Builder::verifyGeometryCaseTable();
+    }
+    catch (exception e)
+    {
+        cout << e.what() << endl;
+        return 1;
+    }
+    const float fbm_batch_error = fbmBatchError();
+    if (fbm_batch_error > FBM_BATCH_TOLERANCE)
+    {
+        cout << format("batched fbm differs from fbm by {0}, more than FBM_BATCH_TOLERANCE ({1})", fbm_batch_error, FBM_BATCH_TOLERANCE) << endl;
+        return 1;
+    }
+
+    string csv_file = generateCSVLine(SummaryStats{}, true);
+
+    auto scalar = runBenchmark("fbm scalar", 10, { -1, -1, -1 }, { 1, 1, 1 }, 0.02f, fbmFunc, 0.0f, Builder::BODY_CENTERED_DIAMOND, Builder::INTEGRATED, 8);
+    csv_file += generateCSVLine(scalar.first);
+    auto batched = runBenchmark("fbm batched", 10, { -1, -1, -1 }, { 1, 1, 1 }, 0.02f, fbmBatchFunc, 0.0f, Builder::BODY_CENTERED_DIAMOND, Builder::INTEGRATED, 8);
+    csv_file += generateCSVLine(batched.first);
+
+    printSpeedupSummary(scalar.first, batched.first);
+
+    Builder compacted_builder;
+    compacted_builder.configure({ -1, -1, -1 }, { 1, 1, 1 }, 0.02f, fbmBatchFunc, 0.0f);
+    compacted_builder.setVertexCompaction(true);
+    auto compacted = runBenchmark("fbm batched compacted", 10, compacted_builder, Builder::BODY_CENTERED_DIAMOND, Builder::INTEGRATED, 8);
+    csv_file += generateCSVLine(compacted.first);
+    printBenchmarkSummary(compacted.first);
+
+    Builder gradient_builder;
+    gradient_builder.configure({ -1, -1, -1 }, { 1, 1, 1 }, 0.02f, fbmBatchFunc, 0.0f);
+    gradient_builder.setNormalMode(Builder::SAMPLE_GRADIENT);
+    auto gradient = runBenchmark("fbm batched gradient normals", 10, gradient_builder, Builder::BODY_CENTERED_DIAMOND, Builder::INTEGRATED, 8);
+    csv_file += generateCSVLine(gradient.first);
+    printSpeedupSummary(batched.first, gradient.first);
+
+    Builder analytic_builder;
+    analytic_builder.configure({ -1, -1, -1 }, { 1, 1, 1 }, 0.02f, fbmGradientFunc, 0.0f);
+    analytic_builder.setNormalMode(Builder::SAMPLER_GRADIENT);
+    auto analytic = runBenchmark("fbm analytic gradient normals", 10, analytic_builder, Builder::BODY_CENTERED_DIAMOND, Builder::INTEGRATED, 8);
+    csv_file += generateCSVLine(analytic.first);
+    printSpeedupSummary(batched.first, analytic.first);
+
+    Builder weighted_builder;
+    weighted_builder.configure({ -1, -1, -1 }, { 1, 1, 1 }, 0.02f, fbmBatchFunc, 0.0f);
+    weighted_builder.setAngleWeightedNormals(true);
+    auto weighted = runBenchmark("fbm batched angle weighted normals", 10, weighted_builder, Builder::BODY_CENTERED_DIAMOND, Builder::INTEGRATED, 8);
+    csv_file += generateCSVLine(weighted.first);
+    printSpeedupSummary(batched.first, weighted.first);
+
+    auto sphere = runBenchmark("sphere", 10, { -2, -2, -2 }, { 2, 2, 2 }, 0.04f, sphereFunc, 0.0f, Builder::BODY_CENTERED_DIAMOND, Builder::INTEGRATED, 8);
+    csv_file += generateCSVLine(sphere.first);
+    Builder inlined_builder;
+    inlined_builder.configure({ -2, -2, -2 }, { 2, 2, 2 }, 0.04f, [](Vector3 v) { return 1.0f - mag(v); }, 0.0f);
+    auto inlined = runBenchmark("sphere inlined", 10, inlined_builder, Builder::BODY_CENTERED_DIAMOND, Builder::INTEGRATED, 8);
+    csv_file += generateCSVLine(inlined.first);
+
+    printSpeedupSummary(sphere.first, inlined.first);
+
+    Builder bounded_builder;
+    bounded_builder.configure({ -2, -2, -2 }, { 2, 2, 2 }, 0.04f, sphereFunc, 0.0f);
+    bounded_builder.setLipschitzConstant(1.0f);
+    auto bounded = runBenchmark("sphere lipschitz", 10, bounded_builder, Builder::BODY_CENTERED_DIAMOND, Builder::INTEGRATED, 8);
+    csv_file += generateCSVLine(bounded.first);
+
+    printSpeedupSummary(sphere.first, bounded.first);
+
+    Builder streaming_builder;
+    streaming_builder.configure({ -2, -2, -2 }, { 2, 2, 2 }, 0.04f, sphereFunc, 0.0f);
+    streaming_builder.setStorageMode(Builder::STREAMING);
+    auto streaming = runBenchmark("sphere streaming", 10, streaming_builder, Builder::BODY_CENTERED_DIAMOND, Builder::INTEGRATED, 8);
+    csv_file += generateCSVLine(streaming.first);
+    printBenchmarkSummary(streaming.first);
+
+    Builder surface_builder;
+    surface_builder.configure({ -2, -2, -2 }, { 2, 2, 2 }, 0.04f, sphereFunc, 0.0f);
+    surface_builder.setStorageMode(Builder::SURFACE_FOLLOWING);
+    surface_builder.setSurfaceSeeds({ { 1, 0, 0 } });
+    auto surface = runBenchmark("sphere surface following", 10, surface_builder, Builder::BODY_CENTERED_DIAMOND, Builder::INTEGRATED, 8);
+    csv_file += generateCSVLine(surface.first);
+    printSpeedupSummary(sphere.first, surface.first);
+
+    // tiled traversal only pays off once the planes stop fitting in cache, so compare at a few resolutions
+    for (float resolution : { 0.08f, 0.04f, 0.02f })
+    {
+        auto untiled = runBenchmark(format("sphere {0} untiled", resolution), 5, { -2, -2, -2 }, { 2, 2, 2 }, resolution, sphereFunc, 0.0f, Builder::BODY_CENTERED_DIAMOND, Builder::INTEGRATED, 8);
+        csv_file += generateCSVLine(untiled.first);
+        Builder tiled_builder;
+        tiled_builder.configure({ -2, -2, -2 }, { 2, 2, 2 }, resolution, sphereFunc, 0.0f);
+        tiled_builder.setTileSize(32);
+        auto tiled = runBenchmark(format("sphere {0} tiled", resolution), 5, tiled_builder, Builder::BODY_CENTERED_DIAMOND, Builder::INTEGRATED, 8);
+        csv_file += generateCSVLine(tiled.first);
+        printSpeedupSummary(untiled.first, tiled.first);
+    }
+
+    auto current_time = chrono::current_zone()->to_local(chrono::system_clock::now());
+    string filename = format("out/benchmark_{0:%d_%m_%Y %H.%M.%S}.csv", current_time);
+    ofstream csv(filename);
+    if (!csv.is_open())
+        return 1;
+    csv << csv_file;
+    csv.close();
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && string(argv[1]) == "benchmark")
+        return benchmarkMain();
+
     GraphicsEnv graphics;
     graphics.create(1024, 1024);
 
@@ -50,9 +194,12 @@ int main()
     //runBenchmark("fbm3", 10, { 0, -1, -1 }, { 0.5f, 1, 1 }, 0.02f, fbmFunc, 0.0f, Builder::BODY_CENTERED_DIAMOND, Builder::INTEGRATED, 8);
     //runBenchmark("fbm4", 10, { 0.5f, -1, -1 }, { 1, 1, 1 }, 0.02f, fbmFunc, 0.0f, Builder::BODY_CENTERED_DIAMOND, Builder::INTEGRATED, 8);
     //
-    /*bunny_mesh.load("res/stanford_bunny/bunny_touchup.obj");
+    /*MappedMesh bunny_mesh;
+    bunny_mesh.load("res/stanford_bunny/bunny_touchup.obj");
 
-    runBenchmark("bunny", 1, { -0.1f, -0.06f, -0.01f }, { 0.1f, 0.08f, 0.16f }, 0.04f, [](Vector3 v) { return bunny_mesh.closestPointSDF(v); }, 0.0F, Builder::BODY_CENTERED_DIAMOND, Builder::INTEGRATED, 8);
+    Builder bunny_builder;
+    bunny_builder.configure({ -0.1f, -0.06f, -0.01f }, { 0.1f, 0.08f, 0.16f }, 0.04f, [&bunny_mesh](Vector3 v) { return bunny_mesh.closestPointSDF(v); }, 0.0f);
+    runBenchmark("bunny", 1, bunny_builder, Builder::BODY_CENTERED_DIAMOND, Builder::INTEGRATED, 8);
     */
     /*auto current_time = chrono::current_zone()->to_local(chrono::system_clock::now());
     string filename = format("out/benchmark_{0:%d_%m_%Y %H.%M.%S}.csv", current_time);
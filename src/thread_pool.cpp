@@ -0,0 +1,159 @@
+#include "thread_pool.h"
+
+using namespace std;
+using namespace MTVT;
+
+ThreadPool::ThreadPool(unsigned short threads)
+{
+    for (unsigned short i = 1; i < threads; ++i)
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lock(state_lock);
+        stopping = true;
+    }
+    work_available.notify_all();
+    for (thread& t : workers)
+        t.join();
+}
+
+void ThreadPool::dispatch(size_t count, const function<void(size_t)>& task)
+{
+    if (count == 0)
+        return;
+    // not worth waking anyone up for
+    if (workers.empty() || count == 1)
+    {
+        for (size_t i = 0; i < count; ++i)
+            task(i);
+        return;
+    }
+
+    lock_guard<mutex> dispatch_guard(dispatch_lock);
+    {
+        lock_guard<mutex> lock(state_lock);
+        current_task = &task;
+        task_count = count;
+        next_task = 0;
+        active_workers = workers.size();
+        ++generation;
+    }
+    work_available.notify_all();
+
+    runTasks(task, count);
+
+    // every worker has to check in before the next dispatch can reuse the state
+    unique_lock<mutex> lock(state_lock);
+    work_finished.wait(lock, [this]() { return active_workers == 0; });
+    current_task = nullptr;
+}
+
+unsigned short ThreadPool::getConcurrency() const
+{
+    return static_cast<unsigned short>(workers.size() + 1);
+}
+
+void ThreadPool::workerLoop()
+{
+    uint64_t last_generation = 0;
+    while (true)
+    {
+        const function<void(size_t)>* task;
+        size_t count;
+        {
+            unique_lock<mutex> lock(state_lock);
+            work_available.wait(lock, [&]() { return stopping || generation != last_generation; });
+            if (stopping)
+                return;
+            last_generation = generation;
+            task = current_task;
+            count = task_count;
+        }
+
+        runTasks(*task, count);
+
+        lock_guard<mutex> lock(state_lock);
+        if (--active_workers == 0)
+            work_finished.notify_one();
+    }
+}
+
+void ThreadPool::runTasks(const function<void(size_t)>& task, size_t count)
+{
+    // tasks are handed out one at a time to whichever thread asks first
+    for (size_t i = next_task.fetch_add(1); i < count; i = next_task.fetch_add(1))
+        task(i);
+}
+
+static inline uint64_t packRange(uint32_t begin, uint32_t end) { return (static_cast<uint64_t>(begin) << 32) | end; }
+static inline uint32_t rangeBegin(uint64_t range) { return static_cast<uint32_t>(range >> 32); }
+static inline uint32_t rangeEnd(uint64_t range) { return static_cast<uint32_t>(range); }
+
+void WorkStealingScheduler::reset(uint32_t tasks, unsigned short workers)
+{
+    if (workers != worker_count || !ranges)
+    {
+        ranges = make_unique<WorkerRange[]>(workers);
+        worker_count = workers;
+    }
+    for (unsigned short w = 0; w < workers; ++w)
+    {
+        const uint32_t begin = static_cast<uint32_t>((static_cast<uint64_t>(tasks) * w) / workers);
+        const uint32_t end = static_cast<uint32_t>((static_cast<uint64_t>(tasks) * (w + 1)) / workers);
+        ranges[w].range.store(packRange(begin, end), memory_order_relaxed);
+    }
+}
+
+bool WorkStealingScheduler::next(unsigned short worker, uint32_t& task, bool& stolen)
+{
+    // take from the front of our own range first
+    atomic<uint64_t>& own = ranges[worker].range;
+    uint64_t current = own.load(memory_order_acquire);
+    while (rangeBegin(current) < rangeEnd(current))
+    {
+        if (own.compare_exchange_weak(current, packRange(rangeBegin(current) + 1, rangeEnd(current)), memory_order_acq_rel))
+        {
+            task = rangeBegin(current);
+            stolen = false;
+            return true;
+        }
+    }
+
+    // out of work, so find whoever has the most left and take the back half of it.
+    // a failed steal just means someone else got there first, so look again
+    while (true)
+    {
+        unsigned short victim = worker;
+        uint64_t victim_range = 0;
+        uint32_t largest = 0;
+        for (unsigned short w = 0; w < worker_count; ++w)
+        {
+            if (w == worker)
+                continue;
+            const uint64_t r = ranges[w].range.load(memory_order_acquire);
+            const uint32_t remaining = (rangeEnd(r) > rangeBegin(r)) ? (rangeEnd(r) - rangeBegin(r)) : 0;
+            if (remaining > largest)
+            {
+                largest = remaining;
+                victim = w;
+                victim_range = r;
+            }
+        }
+        if (largest == 0)
+            return false;
+
+        const uint32_t take = (largest + 1) / 2;
+        const uint32_t split = rangeEnd(victim_range) - take;
+        if (!ranges[victim].range.compare_exchange_strong(victim_range, packRange(rangeBegin(victim_range), split), memory_order_acq_rel))
+            continue;
+
+        // our own range is empty, so nobody else will be touching it
+        task = split;
+        own.store(packRange(split + 1, split + take), memory_order_release);
+        stolen = true;
+        return true;
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+
+namespace MTVT
+{
+
+// interface used by the mesh builder to run its passes in parallel. implement
+// this to plug the builder into an existing job system.
+class Executor
+{
+public:
+    // runs task(0) to task(count - 1), possibly in parallel, and only returns
+    // once every one of them has completed
+    virtual void dispatch(size_t count, const std::function<void(size_t)>& task) = 0;
+    // how many tasks can usefully be run at the same time
+    virtual unsigned short getConcurrency() const = 0;
+
+    virtual ~Executor() = default;
+};
+
+// long-lived pool of worker threads. the thread calling dispatch also takes
+// part in running the tasks, so a pool of N threads only creates N - 1 workers.
+// dispatch calls from different threads are serialised, and dispatching from
+// inside a task is not supported.
+class ThreadPool : public Executor
+{
+private:
+    std::vector<std::thread> workers;
+    std::mutex dispatch_lock;
+    std::mutex state_lock;
+    std::condition_variable work_available;
+    std::condition_variable work_finished;
+
+    const std::function<void(size_t)>* current_task = nullptr;
+    size_t task_count = 0;
+    std::atomic<size_t> next_task = 0;
+    size_t active_workers = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+
+public:
+    ThreadPool(unsigned short threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void dispatch(size_t count, const std::function<void(size_t)>& task) override;
+    unsigned short getConcurrency() const override;
+
+private:
+    void workerLoop();
+    void runTasks(const std::function<void(size_t)>& task, size_t count);
+};
+
+// hands out a fixed set of tasks to a fixed set of workers. each worker starts
+// off owning a contiguous range of tasks, and once it runs out it steals the
+// upper half of whatever is left in the largest remaining range.
+class WorkStealingScheduler
+{
+private:
+    // one range per worker, packed as (begin << 32) | end, padded to avoid false sharing
+    struct alignas(64) WorkerRange
+    {
+        std::atomic<uint64_t> range;
+    };
+
+    std::unique_ptr<WorkerRange[]> ranges;
+    unsigned short worker_count = 0;
+
+public:
+    void reset(uint32_t tasks, unsigned short workers);
+    // fetches the next task for a worker, returns false once there is no work left anywhere
+    bool next(unsigned short worker, uint32_t& task, bool& stolen);
+};
+
+}